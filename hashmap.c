@@ -43,15 +43,29 @@ struct Store {
 	int hash__type;
 	ll_main_t **map;
 
+	// while resizing, the keys that have not moved yet stay in old__map
+	// and a few of its buckets are moved over on every insert / delete.
+	// old__mapPos is the next old bucket to move
+	ll_main_t **old__map;
+	int old__mapSize, old__mapPos;
+
+	int hashmap__count; // how many keys are stored (across both maps)
+
 	// used for printing the hashmap values
 	void (*printer)(void *);
 	// destroying hashmap values
 	void (*destroy)(void *);
 };
 
-const int MAX_BUCKET_SIZE = 5;
 const int START_SIZE = 1023; // how many initial buckets in array
 
+// grow once there are more keys than MAX_LOAD * buckets, shrink
+// (never below START_SIZE) once there are fewer than MIN_LOAD * buckets
+const float MAX_LOAD = 0.75;
+const float MIN_LOAD = 0.125;
+
+const int REHASH_STEP = 8; // fewest old buckets moved per insert / delete
+
 unsigned long hash(unsigned char *str) {
 	unsigned long hash = 5381;
 	int c;
@@ -81,6 +95,12 @@ hashmap *make__hashmap(int hash__type, void (*printer)(void *), void (*destroy)(
 	newMap->hash__type = hash__type;
 	newMap->hashmap__size = START_SIZE;
 
+	newMap->old__map = NULL;
+	newMap->old__mapSize = 0;
+	newMap->old__mapPos = 0;
+
+	newMap->hashmap__count = 0;
+
 	// define needed input functions
 	newMap->printer = printer;
 	newMap->destroy = destroy;
@@ -94,53 +114,77 @@ hashmap *make__hashmap(int hash__type, void (*printer)(void *), void (*destroy)(
 	return newMap;
 }
 
-// take a previous hashmap and double the size of the array
-// this means we have to take all the inputs and calculate
-// a new position in the new array size
-// within hash__m->map we can access each of the linked list pointer
-// and redirect them since we store the keys
-int re__hashmap(hashmap *hash__m) {
-	// define the sizes / updates to size:
-	int old__mapLength = hash__m->hashmap__size;
-	int new__mapLength = hash__m->hashmap__size * 2;
+// moves every key in a single bucket of the old map into the new map
+int move__bucket(hashmap *hash__m, int old__mapPos) {
+	while (hash__m->old__map[old__mapPos]) { // need to look at each linked node
+		// store the node in temporary storage
+		ll_main_t *currNode = hash__m->old__map[old__mapPos];
 
-	// create new map (twice the size of old map (AKA hash__m->map))
-	ll_main_t **new__map = (ll_main_t **) malloc(sizeof(ll_main_t *) * new__mapLength);
+		// recalculate hash
+		int new__mapPos = hash(currNode->key.key) % hash__m->hashmap__size;
 
-	for (int set__newMapNulls = 0; set__newMapNulls < new__mapLength; set__newMapNulls++)
-		new__map[set__newMapNulls] = NULL;
+		// extract currNode from the old map and push it onto
+		// the front of its new bucket
+		hash__m->old__map[old__mapPos] = ll_next(currNode);
 
-	int new__mapPos = 0;
+		currNode->next = hash__m->map[new__mapPos];
+		hash__m->map[new__mapPos] = currNode;
+	}
 
-	for (int old__mapPos = 0; old__mapPos < old__mapLength; old__mapPos++) {
-		// look at each bucket
-		// if there is contents
-		while (hash__m->map[old__mapPos]) { // need to look at each linked node
-			// recalculate hash
-			new__mapPos = hash(hash__m->map[old__mapPos]->key.key) % new__mapLength;
+	return 0;
+}
 
-			// store the node in temporary storage
-			ll_main_t *currNode = hash__m->map[old__mapPos];
+// moves up to step__size buckets from the old map into the
+// new one, freeing the old map once it is empty
+int step__hashmap(hashmap *hash__m, int step__size) {
+	if (!hash__m->old__map)
+		return 0;
 
-			// extract currNode from old map (hash__m->map)
-			hash__m->map[old__mapPos] = ll_next(currNode); // advance root
-			ll_isolate(currNode); // isolate old root
+	for (; step__size && hash__m->old__mapPos < hash__m->old__mapSize; step__size--)
+		move__bucket(hash__m, hash__m->old__mapPos++);
 
-			// defines the linked list head in the new map
-			ll_main_t *new__mapBucketPtr = new__map[new__mapPos];
+	if (hash__m->old__mapPos == hash__m->old__mapSize) {
+		free(hash__m->old__map);
 
-			// if there is one, we have to go to the tail
-			if (new__mapBucketPtr) {
+		hash__m->old__map = NULL;
+		hash__m->old__mapSize = 0;
+		hash__m->old__mapPos = 0;
+	}
 
-				while (new__mapBucketPtr->next) new__mapBucketPtr = ll_next(new__mapBucketPtr);
+	return 0;
+}
 
-				new__mapBucketPtr->next = currNode;
-			} else
-				new__map[new__mapPos] = currNode;
-		}
-	}
+// before touching key, make sure it is not still sitting in the old map
+int settle__hashmap(hashmap *hash__m, void *key) {
+	// move enough buckets that a resize is done before the key count can
+	// halve -- otherwise a shrink is still running when the deletes stop
+	int step__size = hash__m->old__mapSize / (hash__m->hashmap__count / 2 + 1) + 1;
+
+	step__hashmap(hash__m, step__size > REHASH_STEP ? step__size : REHASH_STEP);
+
+	if (hash__m->old__map)
+		move__bucket(hash__m, hash(key) % hash__m->old__mapSize);
+
+	return 0;
+}
+
+// start moving the hashmap into an array of new__mapLength buckets.
+// Rather than moving every key at once (one very slow insert), the
+// current array is kept as old__map and emptied a few buckets at a
+// time by later inserts and deletes (see step__hashmap)
+int re__hashmap(hashmap *hash__m, int new__mapLength) {
+	// only one resize at a time: finish the last one
+	step__hashmap(hash__m, -1);
+
+	ll_main_t **new__map = (ll_main_t **) malloc(sizeof(ll_main_t *) * new__mapLength);
+
+	for (int set__newMapNulls = 0; set__newMapNulls < new__mapLength; set__newMapNulls++)
+		new__map[set__newMapNulls] = NULL;
+
+	hash__m->old__map = hash__m->map;
+	hash__m->old__mapSize = hash__m->hashmap__size;
+	hash__m->old__mapPos = 0;
 
-	free(hash__m->map);
 	hash__m->map = new__map;
 	hash__m->hashmap__size = new__mapLength;
 
@@ -148,24 +192,46 @@ int re__hashmap(hashmap *hash__m) {
 }
 
 int METAinsert__hashmap(hashmap *hash__m, vtableKeyStore key, void *value) {
+	settle__hashmap(hash__m, key.key);
+
 	int mapPos = hash(key.key) % hash__m->hashmap__size;
-	printf("pos %d\n", mapPos);
-	int bucketLength = 0; // counts size of the bucket at mapPos
 
 	// see if there is already a bucket defined at mapPos
-	if (hash__m->map[mapPos])
-		bucketLength = ll_insert(hash__m->map[mapPos], key, value, hash__m->hash__type, hash__m->destroy);
-	else
+	if (!hash__m->map[mapPos]) {
 		hash__m->map[mapPos] = ll_makeNode(key, value, hash__m->hash__type);
+		hash__m->hashmap__count++;
+	} else
+		hash__m->hashmap__count += ll_insert(hash__m->map[mapPos], key, value, hash__m->hash__type, hash__m->destroy);
 
-	// if bucketLength is greater than an arbitrary amount,
-	// need to grow the size of the hashmap (doubling)
-	if (bucketLength >= MAX_BUCKET_SIZE)
-		re__hashmap(hash__m);
+	// grow based on how full the whole map is, not on a single bucket
+	if (!hash__m->old__map && hash__m->hashmap__count > hash__m->hashmap__size * MAX_LOAD)
+		re__hashmap(hash__m, hash__m->hashmap__size * 2);
 
 	return 0;
 }
 
+// finds the linked list node for key, looking in the old map as well
+// if a resize is in progress. This never changes the hashmap
+ll_main_t *find__hashmap(hashmap *hash__m, void *key) {
+	unsigned long key__hash = hash(key);
+
+	ll_main_t *ll_search = hash__m->map[key__hash % hash__m->hashmap__size];
+	// search through the bucket to find any keys that match
+	for (; ll_search; ll_search = ll_next(ll_search))
+		if (ll_search->key.compareKey(ll_search->key.key, key))
+			return ll_search;
+
+	if (!hash__m->old__map)
+		return NULL;
+
+	ll_search = hash__m->old__map[key__hash % hash__m->old__mapSize];
+	for (; ll_search; ll_search = ll_next(ll_search))
+		if (ll_search->key.compareKey(ll_search->key.key, key))
+			return ll_search;
+
+	return NULL;
+}
+
 /*
 	get__hashmap search through a bucket for the inputted key
 	the response varies widely based on hash__type
@@ -181,48 +247,55 @@ int METAinsert__hashmap(hashmap *hash__m, vtableKeyStore key, void *value) {
 			free()ing of this array will leave the key to that array
 			pointing to unknown memory. However, the freeing of the
 			returned struct will be left to the user
+			(see view__hashmap for a version that does not allocate)
 */
 void *get__hashmap(hashmap *hash__m, void *key) {
-	// get hash position
-	int mapPos = hash(key) % hash__m->hashmap__size;
+	ll_main_t *ll_search = find__hashmap(hash__m, key);
 
-	ll_main_t *ll_search = hash__m->map[mapPos];
-	// search through the bucket to find any keys that match
-	while (ll_search) {
-		if (ll_search->key.compareKey(ll_search->key.key, key)) { // found a match
+	if (!ll_search) // no key found
+		return NULL;
 
-			// depending on the type and mode, this will just return
-			// the value:
-			if (hash__m->hash__type == 0)
-				return ll_search->ll_meat;
-			else {
-				hashmap__response *returnMeat = malloc(sizeof(hashmap__response));
+	// depending on the type and mode, this will just return
+	// the value:
+	if (hash__m->hash__type == 0)
+		return ll_search->ll_meat;
 
-				if (ll_search->isArray) {
-					returnMeat->payload = ll_search->ll_meat;
-					returnMeat->payload__length = ll_search->arrIndex + 1;
-				} else { // define array
-					void *ll_tempMeatStorage = ll_search->ll_meat;
+	hashmap__response *returnMeat = malloc(sizeof(hashmap__response));
+	view__hashmap(hash__m, key, returnMeat);
 
-					ll_search->max__arrLength = 2;
-					ll_search->arrIndex = 0;
+	return returnMeat;
+}
 
-					ll_search->ll_meat = malloc(sizeof(void *) * ll_search->max__arrLength * 2);
-					((void **) ll_search->ll_meat)[0] = ll_tempMeatStorage;
+/*
+	view__hashmap fills a caller owned hashmap__response with the values
+	stored under key, without allocating or changing the hashmap, so it
+	is safe for many readers at once. Returns 1 if the key was found and
+	0 otherwise (view->payload is then NULL).
+
+	The view points straight into the hashmap: it is only good until the
+	next insert or delete on this hashmap and must not be freed. A key with
+	a single value is viewed as an array of length 1.
+	Works with both hash__types (type 0 always has length 1)
+*/
+int view__hashmap(hashmap *hash__m, void *key, hashmap__response *view) {
+	ll_main_t *ll_search = find__hashmap(hash__m, key);
 
-					returnMeat->payload = ll_search->ll_meat;
-					returnMeat->payload__length = ll_search->arrIndex + 1;
-				}
+	if (!ll_search) {
+		view->payload = NULL;
+		view->payload__length = 0;
 
-				return returnMeat;
-			}
-		}
+		return 0;
+	}
 
-		ll_search = ll_next(ll_search);
+	if (ll_search->isArray) {
+		view->payload = ll_search->ll_meat;
+		view->payload__length = ll_search->arrIndex + 1;
+	} else { // the single value doubles as a one long array
+		view->payload = &ll_search->ll_meat;
+		view->payload__length = 1;
 	}
 
-	// no key found
-	return NULL;
+	return 1;
 }
 
 int print__hashmap(hashmap *hash__m) {
@@ -233,6 +306,57 @@ int print__hashmap(hashmap *hash__m) {
 			printf("\n");
 		}
 	}
+
+	for (int i = hash__m->old__mapPos; hash__m->old__map && i < hash__m->old__mapSize; i++) {
+		if (hash__m->old__map[i]) {
+			printf("Linked list at old index %d ", i);
+			ll_print(hash__m->old__map[i], hash__m->printer);
+			printf("\n");
+		}
+	}
+
+	return 0;
+}
+
+// after a delete: give memory back once the map is mostly empty
+int shrink__hashmap(hashmap *hash__m) {
+	hash__m->hashmap__count--;
+
+	if (hash__m->hashmap__size == START_SIZE && !hash__m->old__map)
+		return 0;
+
+	// an empty map has nothing to move, so go straight back to START_SIZE
+	if (!hash__m->hashmap__count) {
+		free(hash__m->map);
+		if (hash__m->old__map)
+			free(hash__m->old__map);
+
+		hash__m->old__map = NULL;
+		hash__m->old__mapSize = 0;
+		hash__m->old__mapPos = 0;
+
+		hash__m->hashmap__size = START_SIZE;
+		hash__m->map = (ll_main_t **) malloc(sizeof(ll_main_t *) * START_SIZE);
+
+		for (int i = 0; i < START_SIZE; i++)
+			hash__m->map[i] = NULL;
+
+		return 0;
+	}
+
+	if (hash__m->old__map || hash__m->hashmap__count >= hash__m->hashmap__size * MIN_LOAD)
+		return 0;
+
+	// shrink straight to the smallest size that fits, rather than halving:
+	// halving once per resize falls behind when many keys are deleted
+	int new__mapLength = START_SIZE;
+	while (hash__m->hashmap__count > new__mapLength * MAX_LOAD)
+		new__mapLength *= 2;
+
+	if (new__mapLength < hash__m->hashmap__size)
+		re__hashmap(hash__m, new__mapLength);
+
+	return 0;
 }
 
 // uses the same process as get__hashmap, but deletes the result
@@ -241,10 +365,16 @@ int print__hashmap(hashmap *hash__m) {
 // is being extracted, we need to know what the parent of
 // the node is
 int delete__hashmap(hashmap *hash__m, void *key) {
+	settle__hashmap(hash__m, key);
+
 	// get hash position
 	int mapPos = hash(key) % hash__m->hashmap__size;
 
 	ll_main_t *ll_parent = hash__m->map[mapPos];
+
+	if (!ll_parent) // empty bucket
+		return 0;
+
 	ll_main_t *ll_search = ll_next(ll_parent);
 
 	// check parent then move into children nodes in linked list
@@ -252,9 +382,10 @@ int delete__hashmap(hashmap *hash__m, void *key) {
 		// extract parent from the hashmap:
 		hash__m->map[mapPos] = ll_search;
 
+		ll_isolate(ll_parent);
 		ll_destroy(ll_parent, hash__m->destroy);
 
-		return 0;
+		return shrink__hashmap(hash__m);
 	}
 
 	// search through the bucket to find any keys that match
@@ -265,9 +396,10 @@ int delete__hashmap(hashmap *hash__m, void *key) {
 			// extract the key from the linked list
 			ll_parent->next = ll_next(ll_search);
 
+			ll_isolate(ll_search);
 			ll_destroy(ll_search, hash__m->destroy);
 
-			return 0;
+			return shrink__hashmap(hash__m);
 		}
 
 		ll_parent = ll_search;
@@ -285,13 +417,162 @@ int deepdestroy__hashmap(hashmap *hash) {
 		}
 	}
 
+	for (int i = hash->old__mapPos; hash->old__map && i < hash->old__mapSize; i++) {
+		if (hash->old__map[i]) {
+			ll_destroy(hash->old__map[i], hash->destroy);
+		}
+	}
+
 	// destroy map
 	free(hash->map);
+	if (hash->old__map)
+		free(hash->old__map);
+	free(hash);
+
+	return 0;
+}
+
+/*
+	stepdestroy__hashmap works like deepdestroy__hashmap, spread out over
+	several calls: each call destroys at most budget buckets (a negative
+	budget destroys everything). Returns 1 while there is more left and
+	0 once the hashmap itself has been freed.
+	Once started, the hashmap cannot be used for anything else
+*/
+int stepdestroy__hashmap(hashmap *hash, int budget) {
+	// buckets are taken off the end, so the sizes double as the position
+	for (; budget && hash->old__map && hash->old__mapSize > hash->old__mapPos; budget--) {
+		ll_main_t *bucket = hash->old__map[--hash->old__mapSize];
+
+		if (bucket)
+			ll_destroy(bucket, hash->destroy);
+	}
+
+	for (; budget && hash->hashmap__size; budget--) {
+		ll_main_t *bucket = hash->map[--hash->hashmap__size];
+
+		if (bucket)
+			ll_destroy(bucket, hash->destroy);
+	}
+
+	if (hash->hashmap__size || (hash->old__map && hash->old__mapSize > hash->old__mapPos))
+		return 1;
+
+	free(hash->map);
+	if (hash->old__map)
+		free(hash->old__map);
+	free(hash);
+
+	return 0;
+}
+
+// same as deepdestroy__hashmap, but the values are left alone
+// (pair with iterate__hashmap to hand them off somewhere else first)
+int shallowdestroy__hashmap(hashmap *hash) {
+	for (int i = 0; i < hash->hashmap__size; i++) {
+		if (hash->map[i]) {
+			ll_destroy(hash->map[i], NULL);
+		}
+	}
+
+	for (int i = hash->old__mapPos; hash->old__map && i < hash->old__mapSize; i++) {
+		if (hash->old__map[i]) {
+			ll_destroy(hash->old__map[i], NULL);
+		}
+	}
+
+	free(hash->map);
+	if (hash->old__map)
+		free(hash->old__map);
 	free(hash);
 
 	return 0;
 }
 
+// number of keys currently in the hashmap
+int length__hashmap(hashmap *hash__m) {
+	return hash__m->hashmap__count;
+}
+
+// rough number of bytes used by the hashmap itself: the bucket
+// arrays and the linked list nodes (keys and values not included)
+long footprint__hashmap(hashmap *hash__m) {
+	long old__mapBytes = hash__m->old__map ? sizeof(ll_main_t *) * hash__m->old__mapSize : 0;
+
+	return sizeof(hashmap) + sizeof(ll_main_t *) * hash__m->hashmap__size + old__mapBytes +
+		sizeof(ll_main_t) * hash__m->hashmap__count;
+}
+
+/*
+	sample__hashmap returns a roughly random value from the hashmap, or
+	NULL if it is empty. Buckets are probed at random positions (derived
+	from seed) until one is not empty, so every bucket in use is about
+	as likely as any other -- keys sharing a bucket come up less often.
+	This is a cheap way to pick a value without going through the whole
+	hashmap: it takes about (buckets / keys) probes.
+	For hash__type 1 the first value under the key is returned
+*/
+void *sample__hashmap(hashmap *hash__m, unsigned long seed) {
+	if (!hash__m->hashmap__count)
+		return NULL;
+
+	int old__mapLeft = hash__m->old__map ? hash__m->old__mapSize - hash__m->old__mapPos : 0;
+	int total__buckets = hash__m->hashmap__size + old__mapLeft;
+
+	// after this many misses, fall back on walking the buckets in order
+	int max__probes = 4 * (total__buckets / hash__m->hashmap__count + 1);
+
+	for (int i = 0; i < total__buckets + max__probes; i++) {
+		int sample__pos;
+
+		if (i < max__probes) {
+			seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+			sample__pos = (seed >> 33) % total__buckets;
+		} else
+			sample__pos = i - max__probes;
+
+		ll_main_t *ll_sample = sample__pos < hash__m->hashmap__size ? hash__m->map[sample__pos] :
+			hash__m->old__map[hash__m->old__mapPos + sample__pos - hash__m->hashmap__size];
+
+		if (ll_sample)
+			return ll_sample->isArray ? ((void **) ll_sample->ll_meat)[0] : ll_sample->ll_meat;
+	}
+
+	return NULL;
+}
+
+/*
+	iterate__hashmap calls visit(key, value, arg) for every value in the
+	hashmap. For hash__type 1 each value stored under a key gets its own call.
+	If visit returns anything other than 0 the iteration stops and that
+	value is returned.
+	The hashmap must not be changed while it is being iterated
+*/
+int iterate__hashmap(hashmap *hash__m, int (*visit)(void *, void *, void *), void *arg) {
+	int old__mapLeft = hash__m->old__map ? hash__m->old__mapSize - hash__m->old__mapPos : 0;
+
+	// walk the new map, then whatever has not moved out of the old one
+	for (int i = 0; i < hash__m->hashmap__size + old__mapLeft; i++) {
+		ll_main_t *ll_search = i < hash__m->hashmap__size ? hash__m->map[i] :
+			hash__m->old__map[hash__m->old__mapPos + i - hash__m->hashmap__size];
+
+		for (; ll_search; ll_search = ll_next(ll_search)) {
+			int visit_result = 0;
+
+			if (ll_search->isArray) {
+				for (int visit_val = 0; visit_val < ll_search->arrIndex + 1 && !visit_result; visit_val++)
+					visit_result = visit(ll_search->key.key, ((void **) ll_search->ll_meat)[visit_val], arg);
+			} else
+				visit_result = visit(ll_search->key.key, ll_search->ll_meat, arg);
+
+			if (visit_result)
+				return visit_result;
+		}
+	}
+
+	return 0;
+}
+
 
 ll_main_t *ll_makeNode(vtableKeyStore key, void *newValue, int hash__type) {
 	ll_main_t *new__node = (ll_main_t *) malloc(sizeof(ll_main_t));
@@ -376,7 +657,7 @@ int ll_specialUpdateArray(ll_main_t *ll_pointer, void *newValue) {
 // finds the tail and appends
 int ll_insert(ll_main_t *crawler__node, vtableKeyStore key, void *newValue, int hash__type, void (*destroy)(void *)) {
 
-	int bucket_size = 1, addedPayload = 0;
+	int addedPayload = 0;
 
 	// search through the entire bucket
 	// (each node in this linked list)
@@ -394,10 +675,8 @@ int ll_insert(ll_main_t *crawler__node, vtableKeyStore key, void *newValue, int
 		}
 
 		crawler__node = ll_next(crawler__node);
-		bucket_size++;
 	}
 
-	printf("Testing keys %d\n", crawler__node->key.compareKey(crawler__node->key.key, key.key));
 	if (crawler__node->key.compareKey(crawler__node->key.key, key.key)) {
 		if (hash__type == 0) {
 			crawler__node->ll_meat = ll_specialUpdateIgnore(crawler__node->ll_meat, newValue, destroy);
@@ -412,8 +691,8 @@ int ll_insert(ll_main_t *crawler__node, vtableKeyStore key, void *newValue, int
 		crawler__node->next = ll_makeNode(key, newValue, hash__type);
 	}
 
-	// return same head
-	return bucket_size;
+	// 1 if a new key was added, 0 if the key was already there
+	return !addedPayload;
 }
 
 ll_main_t *ll_next(ll_main_t *curr) {
@@ -464,11 +743,12 @@ int ll_destroy(ll_main_t *node, void (destroyObjectPayload)(void *)) {
 			node->key.destroyKey(node->key.key);
 
 		if (node->isArray) {
-			for (int destroyVal = 0; destroyVal < node->arrIndex + 1; destroyVal++)
-				destroyObjectPayload(((void **)node->ll_meat)[destroyVal]);
+			if (destroyObjectPayload)
+				for (int destroyVal = 0; destroyVal < node->arrIndex + 1; destroyVal++)
+					destroyObjectPayload(((void **)node->ll_meat)[destroyVal]);
 
 			free(node->ll_meat);
-		} else
+		} else if (destroyObjectPayload)
 			destroyObjectPayload(node->ll_meat);
 
 		node_nextStore = node->next;
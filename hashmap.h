@@ -1,7 +1,7 @@
 #ifndef __HASH_T__
 #define __HASH_T__
 
-typedef struct ReturnHashmap { // used only for type 1
+typedef struct ReturnHashmap { // used for type 1 (and view__hashmap)
 	void **payload;
 	int payload__length;
 } hashmap__response;
@@ -11,12 +11,21 @@ typedef struct Store hashmap;
 hashmap *make__hashmap(int hash__type, void (*printer)(void *), void (*destroy)(void *));
 
 void *get__hashmap(hashmap *hash__m, void *key);
+int view__hashmap(hashmap *hash__m, void *key, hashmap__response *view);
 
 int print__hashmap(hashmap *hash__m);
 
 int delete__hashmap(hashmap *hash__m, void *key);
 
 int deepdestroy__hashmap(hashmap *hash);
+int shallowdestroy__hashmap(hashmap *hash);
+int stepdestroy__hashmap(hashmap *hash, int budget);
+
+int iterate__hashmap(hashmap *hash__m, int (*visit)(void *, void *, void *), void *arg);
+void *sample__hashmap(hashmap *hash__m, unsigned long seed);
+
+int length__hashmap(hashmap *hash__m);
+long footprint__hashmap(hashmap *hash__m);
 
 int insert__hashmap(hashmap *hash__m, void *key, void *value, ...);
 
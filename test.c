@@ -1,7 +1,9 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
+#include "hashmap.h"
 #include "trie.h"
 
 int compare_int(void *i1, void *i2) {
@@ -23,6 +25,12 @@ int delete_int(void *i) {
 	return 0;
 }
 
+int count_match(char *key, int weight, void *total_weight) {
+	*(int *) total_weight += weight;
+
+	return 0;
+}
+
 int test() {
 	/* UNSTRUCTURED INPUT */
 	trie_t *trie_first = trie_create("-pc");
@@ -35,6 +43,7 @@ int test() {
 	assert(trie_search(trie_first, "cow") == 0);
 	assert(trie_search(trie_first, "bab") == 1);
 	assert(trie_search(trie_first, "ace") == 2);
+	assert(trie_search(trie_first, "ca") == 0);
 
 	trie_destroy(trie_first);
 
@@ -48,6 +57,251 @@ int test() {
 	}
 	trie_insert(trie_second, test1);
 
+	/* GRAPH MODE -- sorted input, shared suffixes */
+	trie_t *trie_graph = trie_create("-pc -g");
+
+	assert(trie_create("-pv -g") == NULL);
+
+	assert(trie_insert(trie_graph, "baking") == 0);
+	assert(trie_insert(trie_graph, "bathing") == 0);
+	assert(trie_insert(trie_graph, "cooking") == 0);
+	assert(trie_insert(trie_graph, "eat") == 0);
+	assert(trie_insert(trie_graph, "eating") == 0);
+	assert(trie_insert(trie_graph, "eating") == 0);
+	assert(trie_insert(trie_graph, "apple") == 1); // out of order
+
+	assert(trie_search(trie_graph, "bathing") == 1);
+	assert(trie_search(trie_graph, "eat") == 1);
+	assert(trie_search(trie_graph, "eating") == 2);
+	assert(trie_search(trie_graph, "eati") == 0);
+
+	assert(trie_seal(trie_graph) == 0);
+	assert(trie_insert(trie_graph, "sitting") == 1);
+
+	assert(trie_search(trie_graph, "baking") == 1);
+	assert(trie_search(trie_graph, "cooking") == 1);
+	assert(trie_search(trie_graph, "eating") == 2);
+	assert(trie_search(trie_graph, "cook") == 0);
+
+	trie_destroy(trie_graph);
+
+	/* SNAPSHOTS -- the snapshot keeps what the trie looked like */
+	trie_t *trie_live = trie_create("-pc");
+
+	trie_insert(trie_live, "dog");
+	trie_insert(trie_live, "door");
+
+	trie_t *trie_snap = trie_snapshot(trie_live);
+
+	trie_insert(trie_live, "dog");
+	trie_insert(trie_live, "dot");
+
+	assert(trie_search(trie_live, "dog") == 2);
+	assert(trie_search(trie_live, "dot") == 1);
+
+	assert(trie_search(trie_snap, "dog") == 1);
+	assert(trie_search(trie_snap, "door") == 1);
+	assert(trie_search(trie_snap, "dot") == 0);
+	assert(trie_insert(trie_snap, "dot") == 1);
+
+	trie_destroy(trie_live);
+
+	assert(trie_search(trie_snap, "door") == 1);
+
+	trie_destroy(trie_snap);
+
+	/* MERGING SHARDS */
+	trie_t *shard_one = trie_create("-pc"), *shard_two = trie_create("-pc");
+
+	trie_insert(shard_one, "car");
+	trie_insert(shard_one, "cart");
+	trie_insert(shard_two, "car");
+	trie_insert(shard_two, "dust");
+
+	trie_t *trie_both = trie_union(shard_one, shard_two);
+
+	assert(trie_search(trie_both, "car") == 2);
+	assert(trie_search(trie_both, "cart") == 1);
+	assert(trie_search(trie_both, "dust") == 1);
+	assert(trie_search(shard_one, "car") == 1);
+	assert(trie_search(shard_one, "dust") == 0);
+
+	trie_insert(trie_both, "dusty");
+	assert(trie_search(shard_two, "dusty") == 0);
+
+	assert(trie_merge(shard_one, shard_two) == 0);
+
+	assert(trie_search(shard_one, "car") == 2);
+	assert(trie_search(shard_one, "dust") == 1);
+	assert(trie_search(shard_one, "dusty") == 0);
+	assert(trie_search(trie_both, "dusty") == 1);
+
+	trie_destroy(shard_one);
+	trie_destroy(trie_both);
+
+	/* BOUNDED -- cold keys are evicted, hot ones stay */
+	long budget = 200000;
+	trie_t *trie_cache = trie_create("-pc -m", budget);
+
+	assert(trie_create("-pc -g -m", budget) == NULL);
+
+	srand(1);
+	for (int query = 0; query < 400; query++) {
+		char cold_key[6];
+
+		for (int key_char = 0; key_char < 5; key_char++)
+			cold_key[key_char] = 'a' + rand() % 26;
+		cold_key[5] = '\0';
+
+		trie_insert(trie_cache, query % 4 ? cold_key : "hot");
+		assert(trie_footprint(trie_cache) <= budget);
+	}
+
+	assert(trie_search(trie_cache, "hot") == 100);
+
+	trie_destroy(trie_cache);
+
+	/* PATTERN QUERIES */
+	trie_t *trie_words = trie_create("-pc");
+
+	trie_insert(trie_words, "cat");
+	trie_insert(trie_words, "cut");
+	trie_insert(trie_words, "cot");
+	trie_insert(trie_words, "cart");
+	trie_insert(trie_words, "abacus");
+	trie_insert(trie_words, "ab");
+	trie_insert(trie_words, "ex");
+	trie_insert(trie_words, "ox");
+	trie_insert(trie_words, "oxen");
+	trie_insert(trie_words, "oxen");
+
+	int pattern_matches = 0;
+
+	assert(trie_match_pattern(trie_words, "c?t", count_match, 0, &pattern_matches) == 3);
+	assert(trie_match_pattern(trie_words, "ab*", count_match, 0, &pattern_matches) == 2);
+	assert(trie_match_pattern(trie_words, "[aeiou]x*", count_match, 0, &pattern_matches) == 3);
+	assert(trie_match_pattern(trie_words, "[!c]*", count_match, 0, &pattern_matches) == 5);
+	assert(trie_match_pattern(trie_words, "c[a-o]*t", count_match, 0, &pattern_matches) == 3);
+	assert(trie_match_pattern(trie_words, "*", count_match, 2, &pattern_matches) == 2);
+	assert(trie_match_pattern(trie_words, "ca", count_match, 0, &pattern_matches) == 0);
+	assert(trie_match_pattern(trie_words, "[ab", count_match, 0, &pattern_matches) == -1);
+
+	pattern_matches = 0;
+	trie_match_pattern(trie_words, "o*", count_match, 0, &pattern_matches);
+	assert(pattern_matches == 3); // ox + oxen twice
+
+	trie_destroy(trie_words);
+
+	/* STEPPED DESTROY */
+	trie_t *trie_retired = trie_create("-pc");
+
+	trie_insert(trie_retired, "tiger");
+	trie_insert(trie_retired, "tile");
+	trie_insert(trie_retired, "toad");
+
+	assert(trie_destroy_step(trie_retired, 2) == 1);
+	assert(trie_search(trie_retired, "tile") == 0);
+	assert(trie_insert(trie_retired, "tick") == 1);
+
+	while (trie_destroy_step(trie_retired, 2));
+
+	/* STEPPED DESTROY -- unsealed graph */
+	trie_t *graph_retired = trie_create("-pc -g");
+
+	trie_insert(graph_retired, "bake");
+	trie_insert(graph_retired, "cake");
+	trie_insert(graph_retired, "make");
+
+	int destroy_steps = 1;
+	while (trie_destroy_step(graph_retired, 64))
+		destroy_steps++;
+
+	assert(destroy_steps > 1); // the register alone takes a few steps
+
+	/* HASHMAP -- growing and shrinking while resizes are in flight */
+	hashmap *map = make__hashmap(0, NULL, free);
+
+	for (int add_key = 0; add_key < 5000; add_key++) {
+		char *key = malloc(sizeof(char) * 8);
+		sprintf(key, "k%d", add_key);
+
+		insert__hashmap(map, key, key, "-d");
+	}
+
+	for (int check_key = 0; check_key < 5000; check_key++) {
+		char key[8];
+		sprintf(key, "k%d", check_key);
+
+		assert(strcmp(get__hashmap(map, key), key) == 0);
+	}
+
+	for (int delete_key = 0; delete_key < 4990; delete_key++) {
+		char key[8];
+		sprintf(key, "k%d", delete_key);
+
+		delete__hashmap(map, key);
+	}
+
+	assert(get__hashmap(map, "k10") == NULL);
+	assert(strcmp(get__hashmap(map, "k4995"), "k4995") == 0);
+
+	deepdestroy__hashmap(map);
+
+	/* HASHMAP -- emptying a grown map gives its memory back */
+	hashmap *drained_map = make__hashmap(0, NULL, free);
+	long start_footprint = footprint__hashmap(drained_map);
+
+	for (int add_key = 0; add_key < 20000; add_key++) {
+		char *key = malloc(sizeof(char) * 8);
+		sprintf(key, "k%d", add_key);
+
+		insert__hashmap(drained_map, key, key, "-d");
+	}
+
+	assert(length__hashmap(drained_map) == 20000);
+	assert(footprint__hashmap(drained_map) > 10 * start_footprint);
+
+	for (int delete_key = 0; delete_key < 20000; delete_key++) {
+		char key[8];
+		sprintf(key, "k%d", delete_key);
+
+		delete__hashmap(drained_map, key);
+
+		if (delete_key == 19990) // a few keys left
+			assert(footprint__hashmap(drained_map) < 3 * start_footprint);
+	}
+
+	assert(length__hashmap(drained_map) == 0);
+	assert(footprint__hashmap(drained_map) == start_footprint);
+
+	deepdestroy__hashmap(drained_map);
+
+	/* HASHMAP -- reading multiple values without allocating */
+	hashmap *multi_map = make__hashmap(1, NULL, free);
+	hashmap__response view;
+
+	int *first_value = malloc(sizeof(int)), *second_value = malloc(sizeof(int));
+	*first_value = 1;
+	*second_value = 2;
+
+	insert__hashmap(multi_map, "key", first_value, "-d");
+
+	assert(view__hashmap(multi_map, "key", &view) == 1);
+	assert(view.payload__length == 1 && *(int *) view.payload[0] == 1);
+
+	insert__hashmap(multi_map, "key", second_value, "-d");
+
+	assert(view__hashmap(multi_map, "key", &view) == 1);
+	assert(view.payload__length == 2 && *(int *) view.payload[1] == 2);
+
+	assert(view__hashmap(multi_map, "missing", &view) == 0);
+
+	hashmap__response *get_response = get__hashmap(multi_map, "key");
+	assert(get_response->payload__length == 2);
+	free(get_response);
+
+	deepdestroy__hashmap(multi_map);
+
 	return 0;
 }
 
@@ -45,19 +45,87 @@ typedef struct TrieNode {
 	int thru_weight;
 	int end_weight;
 
+	long bytes; // rough memory used by this node and everything below it
+	unsigned long touched; // trie tick of the last insert / search through here
+
+	// how many parents point at this node -- the node is only freed
+	// once the last of them lets go (graph states have many parents)
+	int refs;
+
+	// graph mode only: outgoing labels in the order they were added.
+	// The labels live here instead of in the child's payload since
+	// a shared child is reached through a different label per parent
+	char **order;
+	int order_length, order_max;
+
 	hashmap *children;
 } node_t;
 
-void node_destroy(void *void_node) {
-	node_t *node = (node_t *) void_node;
+/*
+	Nodes are freed with an explicit stack instead of recursion, so
+	deep keys cannot overflow the call stack and the work can be
+	split into steps (see trie_destroy_step)
+*/
+typedef struct NodeStack {
+	node_t **node;
+	int length, max;
+} node_stack;
+
+int node_stack_push(node_stack *stack, node_t *node) {
+	if (stack->length == stack->max) {
+		stack->max = stack->max ? stack->max * 2 : 16;
+		stack->node = realloc(stack->node, sizeof(node_t *) * stack->max);
+	}
+
+	stack->node[stack->length++] = node;
+
+	return 0;
+}
+
+// iterate__hashmap visitor
+int node_stack_push_child(void *key, void *child, void *stack) {
+	return node_stack_push((node_stack *) stack, (node_t *) child);
+}
+
+/*
+	drops one reference from up to budget nodes on the stack (a negative
+	budget runs until the stack is empty). A node that loses its last
+	reference is freed and its children are pushed for later
+*/
+int node_stack_reclaim(node_stack *stack, int budget) {
+	while (stack->length && budget--) {
+		node_t *node = stack->node[--stack->length];
+
+		if (--node->refs > 0)
+			continue;
+
+		if (node->children) {
+			iterate__hashmap(node->children, node_stack_push_child, stack);
+			shallowdestroy__hashmap(node->children);
+		}
+
+		if (node->destroy_payload)
+			node->destroy_payload(node->payload);
+
+		for (int free_order = 0; free_order < node->order_length; free_order++)
+			free(node->order[free_order]);
 
-	if (node->children)
-		deepdestroy__hashmap(node->children);
+		if (node->order)
+			free(node->order);
 
-	if (node->destroy_payload)
-		node->destroy_payload(node->payload);
+		free(node);
+	}
+
+	return stack->length;
+}
+
+void node_destroy(void *void_node) {
+	node_stack stack = { .node = NULL, .length = 0, .max = 0 };
+
+	node_stack_push(&stack, (node_t *) void_node);
+	node_stack_reclaim(&stack, -1);
 
-	free(node);
+	free(stack.node);
 
 	return;
 }
@@ -71,7 +139,16 @@ node_t *node_construct(void *payload, int (*delete)(void *)) {
 	new_node->thru_weight = 0;
 	new_node->end_weight = 0;
 
+	new_node->touched = 0;
+
+	new_node->refs = 1;
+
+	new_node->order = NULL;
+	new_node->order_length = 0;
+	new_node->order_max = 0;
+
 	new_node->children = make__hashmap(0, NULL, node_destroy);
+	new_node->bytes = sizeof(node_t) + footprint__hashmap(new_node->children);
 
 	return new_node;
 }
@@ -84,7 +161,29 @@ struct Trie {
 
 	int (*delete)(void *);
 
-	hashmap *root_node;
+	node_t *root_node;
+
+	// graph mode ("-g"): keys arrive sorted and equivalent states are
+	// merged as we go, giving a minimal acyclic word graph
+	int graph_mode, graph_sealed;
+	hashmap *graph_register; // state signature -> canonical state
+	char *graph_last; // previous key, used to find the shared prefix
+
+	// a state can end many keys, so per key weights are kept by rank
+	// (the key's position in sorted order) instead of in end_weight
+	int *graph_weight;
+	int graph_keys, graph_max;
+
+	// set once trie_destroy_step has started taking the trie apart
+	node_stack *reclaim;
+
+	int read_only; // snapshots (see trie_snapshot)
+
+	// bounded mode ("-m"): once root_node->bytes goes over budget, cold
+	// subtrees are evicted (see trie_evict). 0 means no budget
+	long budget;
+	unsigned long tick; // bumped by every insert, used for recency
+	unsigned long sample_seed;
 };
 
 /*
@@ -104,12 +203,32 @@ struct Trie {
 		linked list, char *, etc.) -- will set to default (char *) if not inputted
 		'd': to delete values post insertion. For a char *, just go through and
 		cleans stored data
+		'g': graph mode, builds a minimal acyclic word graph (suffixes are
+		shared as well as prefixes). Keys must be inserted in sorted order
+		and only char payloads ('-pc') are supported
+		'm': memory budget in bytes (as a long). Once the trie grows past
+		the budget the coldest keys are evicted. Cannot be used with 'g'
 */
 trie_t *trie_create(char *param, ...) {
 	trie_t *new_trie = malloc(sizeof(trie_t));
 
 	new_trie->payload_type = 1;
-	new_trie->root_node = make__hashmap(0, NULL, node_destroy);
+	new_trie->root_node = node_construct(NULL, NULL);
+
+	new_trie->graph_mode = 0;
+	new_trie->graph_sealed = 0;
+	new_trie->graph_register = NULL;
+	new_trie->graph_last = NULL;
+	new_trie->graph_weight = NULL;
+	new_trie->graph_keys = 0;
+	new_trie->graph_max = 0;
+
+	new_trie->reclaim = NULL;
+	new_trie->read_only = 0;
+
+	new_trie->budget = 0;
+	new_trie->tick = 0;
+	new_trie->sample_seed = 88172645463325252UL;
 
 	new_trie->next = default_next;
 	new_trie->comparer = default_comparer;
@@ -146,73 +265,918 @@ trie_t *trie_create(char *param, ...) {
 		} else if (param[find_p + 1] == 'd') {
 			printf("add delete");
 			new_trie->delete = va_arg(param_detail, int (*)(void *));
+		} else if (param[find_p + 1] == 'g')
+			new_trie->graph_mode = 1;
+		else if (param[find_p + 1] == 'm')
+			new_trie->budget = va_arg(param_detail, long);
+	}
+
+	va_end(param_detail);
+
+	if (new_trie->graph_mode) {
+		// sorting needs char payloads, and states shared
+		// between keys cannot be evicted one key at a time
+		if (!new_trie->payload_type || new_trie->budget) {
+			trie_destroy(new_trie);
+			return NULL;
 		}
+
+		new_trie->graph_register = make__hashmap(0, NULL, node_destroy);
 	}
 
 	// return updated new_trie
 	return new_trie;
 }
 
-int trie_insert_helper(hashmap *curr_node, trie_t *trie_meta_data, void *value) {
+/*
+	COPY ON WRITE
+
+	A node with more than one reference is shared with a snapshot, so it
+	must be copied before it is changed. The copy holds its own reference
+	to every child, which means the children count as shared too, and so
+	a write ends up copying exactly the nodes along its path
+*/
+// the node being built up, and the trie it belongs to (for iterate__hashmap visitors)
+typedef struct NodeWalk {
+	node_t *node;
+	trie_t *trie;
+
+	long bytes; // bytes added under node so far
+} node_walk_t;
+
+// iterate__hashmap visitor
+int node_copy_child(void *key, void *void_child, void *void_walk) {
+	node_t *child = (node_t *) void_child;
+	node_walk_t *walk = (node_walk_t *) void_walk;
+
+	child->refs++;
+	insert__hashmap(walk->node->children, child->payload, child, "", walk->trie->comparer, NULL);
+
+	return 0;
+}
+
+node_t *node_copy(trie_t *trie, node_t *node) {
+	node_walk_t walk = {
+		.node = node_construct(node->payload ? singleton_maker(node->payload) : NULL, node->destroy_payload),
+		.trie = trie
+	};
+
+	walk.node->thru_weight = node->thru_weight;
+	walk.node->end_weight = node->end_weight;
+
+	walk.node->bytes = node->bytes;
+	walk.node->touched = node->touched;
+
+	iterate__hashmap(node->children, node_copy_child, &walk);
+
+	return walk.node;
+}
+
+// makes sure parent's child (at key) is not shared before it is changed
+node_t *node_unshare(trie_t *trie, node_t *parent, node_t *child, void *key) {
+	if (child->refs == 1)
+		return child;
+
+	node_t *copy = node_copy(trie, child);
+
+	// the delete drops parent's reference to the shared child
+	delete__hashmap(parent->children, key);
+	insert__hashmap(parent->children, copy->payload, copy, "", trie->comparer, NULL);
+
+	return copy;
+}
+
+int trie_unshare_root(trie_t *trie) {
+	if (trie->root_node->refs == 1)
+		return 0;
+
+	node_t *root_copy = node_copy(trie, trie->root_node);
+
+	trie->root_node->refs--;
+	trie->root_node = root_copy;
+
+	return 0;
+}
+
+// returns how many bytes were added below curr_node
+long trie_insert_helper(node_t *curr_node, trie_t *trie_meta_data, void *value) {
 	char *build_alloc_char = trie_meta_data->payload_type ? singleton_maker(value) : NULL;
-	node_t *sub_node = get__hashmap(curr_node, build_alloc_char ? build_alloc_char : value);
+	node_t *sub_node = get__hashmap(curr_node->children, build_alloc_char ? build_alloc_char : value);
 
 	void *get_next_value = trie_meta_data->next(value);
+	long added_bytes = 0;
+
+	if (sub_node) {
+		sub_node = node_unshare(trie_meta_data, curr_node, sub_node, build_alloc_char ? build_alloc_char : value);
 
-	if (get_next_value && sub_node) {
 		if (build_alloc_char)
 			free(build_alloc_char);
-
-		sub_node->thru_weight++;
 	} else {
-		if (!sub_node) {
-			sub_node = node_construct(build_alloc_char ? build_alloc_char : value, trie_meta_data->delete);
-			insert__hashmap(curr_node, build_alloc_char ? build_alloc_char : value, sub_node, "", trie_meta_data->comparer, NULL);
-		} else
-			free(build_alloc_char);
+		long map_bytes = footprint__hashmap(curr_node->children);
 
+		sub_node = node_construct(build_alloc_char ? build_alloc_char : value, trie_meta_data->delete);
+		insert__hashmap(curr_node->children, build_alloc_char ? build_alloc_char : value, sub_node, "", trie_meta_data->comparer, NULL);
+
+		added_bytes = sub_node->bytes + footprint__hashmap(curr_node->children) - map_bytes;
+	}
+
+	sub_node->touched = trie_meta_data->tick;
+
+	// only the last node of the value counts as an end
+	if (!get_next_value) {
 		sub_node->end_weight++;
-		if (!get_next_value)
-			return 0;
+		return added_bytes;
 	}
 
-	return trie_insert_helper(sub_node->children, trie_meta_data, get_next_value);
+	sub_node->thru_weight++;
+
+	long below_bytes = trie_insert_helper(sub_node, trie_meta_data, get_next_value);
+	sub_node->bytes += below_bytes;
+
+	return added_bytes + below_bytes;
 }
 
+int trie_trim(trie_t *trie);
+
+int graph_insert(trie_t *trie, char *key);
+
 // the value that comes after trie depends on weight_option
 // either void * for weight_option = 0 or char for weight_option = 1
 int trie_insert(trie_t *trie, void *p_value) {
-	return trie_insert_helper(trie->root_node, trie, p_value);
+	if (!trie->root_node || trie->read_only)
+		return 1;
+
+	if (trie->graph_mode)
+		return graph_insert(trie, p_value);
+
+	trie_unshare_root(trie);
+
+	trie->tick++;
+	trie->root_node->touched = trie->tick;
+	trie->root_node->bytes += trie_insert_helper(trie->root_node, trie, p_value);
+
+	return trie_trim(trie);
 }
 
-int trie_search_helper(hashmap *curr_node, trie_t *trie_meta_data, void *value) {
+int trie_search_helper(node_t *curr_node, trie_t *trie_meta_data, void *value) {
 	char *build_alloc_char = trie_meta_data->payload_type ? singleton_maker(value) : NULL;
-	node_t *sub_node = get__hashmap(curr_node, build_alloc_char ? build_alloc_char : value);
+	node_t *sub_node = get__hashmap(curr_node->children, build_alloc_char ? build_alloc_char : value);
 
 	void *get_next_value = trie_meta_data->next(value);
 
 	if (build_alloc_char)
 		free(build_alloc_char);
 
+	// searches count as a use when deciding what to evict
+	if (sub_node && trie_meta_data->budget && !trie_meta_data->read_only)
+		sub_node->touched = trie_meta_data->tick;
+
 	if (get_next_value && sub_node)
-		return trie_search_helper(sub_node->children, trie_meta_data, get_next_value);
+		return trie_search_helper(sub_node, trie_meta_data, get_next_value);
 	else if (sub_node && sub_node->end_weight)
 		return sub_node->end_weight;
 
 	return 0;
 }
 
+int graph_search(trie_t *trie, char *key);
+
 int trie_search(trie_t *trie, void *p_value) {
 	if (!trie->root_node)
 		return 0;
 
+	if (trie->graph_mode)
+		return graph_search(trie, p_value);
+
 	return trie_search_helper(trie->root_node, trie, p_value);
 }
 
-int trie_destroy(trie_t *trie) {
-	deepdestroy__hashmap(trie->root_node);
+/*
+	trie_snapshot returns a read only copy of the trie as it is right now.
+	Nothing is copied up front: the snapshot shares every node with the
+	trie, and later inserts into the trie copy only the nodes along the
+	path they change (the snapshot keeps the originals).
+	The snapshot can be searched like any other trie and is released with
+	trie_destroy (or trie_destroy_step), which frees only the nodes no
+	longer shared with the trie.
+
+	Returns NULL for '-pv' tries (copying a node copies its payload, which
+	only works for the trie's own char payloads) and graph mode tries
+*/
+trie_t *trie_snapshot(trie_t *trie) {
+	if (!trie->payload_type || trie->graph_mode || !trie->root_node)
+		return NULL;
+
+	trie_t *snapshot = malloc(sizeof(trie_t));
+
+	*snapshot = *trie;
+	snapshot->read_only = 1;
+
+	snapshot->root_node->refs++;
+
+	return snapshot;
+}
+
+/*
+	MERGING
+
+	Both tries are walked together. Where a node exists in both, the
+	weights are added and the walk continues into the children; where a
+	src subtree has no counterpart in dst, the whole subtree is grafted
+	into dst by taking a reference to it -- nothing under it is visited.
+	Nodes in dst that are shared are copied before their weights change
+	(see COPY ON WRITE), so src is never modified
+*/
+long node_merge(trie_t *trie, node_t *dst, node_t *src);
+
+// iterate__hashmap visitor
+int node_merge_child(void *key, void *void_child, void *void_walk) {
+	node_t *child = (node_t *) void_child;
+	node_walk_t *walk = (node_walk_t *) void_walk;
+
+	node_t *dst_child = get__hashmap(walk->node->children, child->payload);
+
+	if (!dst_child) { // graft
+		long map_bytes = footprint__hashmap(walk->node->children);
+
+		child->refs++;
+		insert__hashmap(walk->node->children, child->payload, child, "", walk->trie->comparer, NULL);
+
+		walk->bytes += child->bytes + footprint__hashmap(walk->node->children) - map_bytes;
+
+		return 0;
+	}
+
+	dst_child = node_unshare(walk->trie, walk->node, dst_child, child->payload);
+	walk->bytes += node_merge(walk->trie, dst_child, child);
+
+	return 0;
+}
+
+// returns how many bytes were added below dst
+long node_merge(trie_t *trie, node_t *dst, node_t *src) {
+	node_walk_t walk = { .node = dst, .trie = trie, .bytes = 0 };
+
+	dst->thru_weight += src->thru_weight;
+	dst->end_weight += src->end_weight;
+
+	iterate__hashmap(src->children, node_merge_child, &walk);
+	dst->bytes += walk.bytes;
+
+	return walk.bytes;
+}
+
+// merging shares nodes between the tries, so it has the same limits as trie_snapshot
+int trie_can_merge(trie_t *dst, trie_t *src) {
+	return dst != src && dst->root_node && src->root_node &&
+		dst->payload_type && src->payload_type &&
+		!dst->graph_mode && !src->graph_mode;
+}
+
+/*
+	trie_merge moves all of src into dst (weights of keys found in both
+	are added) and destroys src. Subtrees only found in src are moved over
+	as a whole, so the cost follows the overlap between the two tries
+	rather than their size.
+	Returns 1 (and leaves both tries alone) if they cannot be merged:
+	dst is a snapshot, either trie uses '-pv' or graph mode
+*/
+int trie_merge(trie_t *dst, trie_t *src) {
+	if (dst->read_only || !trie_can_merge(dst, src))
+		return 1;
+
+	trie_unshare_root(dst);
+	node_merge(dst, dst->root_node, src->root_node);
+
+	// whatever was grafted into dst keeps a reference and survives
+	trie_destroy(src);
+
+	return trie_trim(dst);
+}
+
+/*
+	trie_union builds a new trie holding the keys of both trie_a and
+	trie_b, leaving both of them as they were. The new trie shares every
+	subtree it can with the two inputs (later inserts into any of the
+	three copy on write). Returns NULL where trie_merge would return 1
+*/
+trie_t *trie_union(trie_t *trie_a, trie_t *trie_b) {
+	if (!trie_can_merge(trie_a, trie_b))
+		return NULL;
+
+	trie_t *new_trie = malloc(sizeof(trie_t));
+
+	*new_trie = *trie_a;
+	new_trie->read_only = 0;
+	new_trie->root_node = node_construct(NULL, NULL);
+
+	node_merge(new_trie, new_trie->root_node, trie_a->root_node);
+	node_merge(new_trie, new_trie->root_node, trie_b->root_node);
+
+	trie_trim(new_trie);
+
+	return new_trie;
+}
+
+/*
+	BOUNDED MODE
+
+	Eviction is sampled rather than exact, so it stays cheap no matter how
+	big the trie is: starting at the root, a few children are picked at
+	random and the coldest one (fewest keys through it, then least recently
+	used) is followed down until it is a leaf or was only ever used by a
+	single key. That subtree is cut off and the ancestors' byte counts and
+	weights are brought down to match.
+	A new key competes like any other: with a weight of 1 and the newest
+	tick it loses to older keys used just as often, but if everything
+	else is hotter the new key itself is what gets evicted
+*/
+const int EVICT_SAMPLES = 5;
+
+unsigned long trie_random(trie_t *trie) { // xorshift
+	trie->sample_seed ^= trie->sample_seed << 13;
+	trie->sample_seed ^= trie->sample_seed >> 7;
+	trie->sample_seed ^= trie->sample_seed << 17;
+
+	return trie->sample_seed;
+}
+
+int node_colder(node_t *node, node_t *other) {
+	int node_weight = node->thru_weight + node->end_weight;
+	int other_weight = other->thru_weight + other->end_weight;
+
+	return node_weight < other_weight || (node_weight == other_weight && node->touched < other->touched);
+}
+
+// returns 1 if there was nothing that could be evicted
+int trie_evict(trie_t *trie) {
+	node_stack path = { .node = NULL, .length = 0, .max = 0 };
+	node_t *parent = trie->root_node, *cold;
+
+	while (1) {
+		cold = NULL;
+
+		for (int sample = 0; sample < EVICT_SAMPLES; sample++) {
+			node_t *candidate = sample__hashmap(parent->children, trie_random(trie));
+
+			if (candidate && (!cold || node_colder(candidate, cold)))
+				cold = candidate;
+		}
+
+		if (!cold || !length__hashmap(cold->children) || cold->thru_weight + cold->end_weight <= 1)
+			break;
+
+		node_stack_push(&path, parent);
+		parent = node_unshare(trie, parent, cold, cold->payload);
+	}
+
+	if (!cold) {
+		free(path.node);
+		return 1;
+	}
+
+	node_stack_push(&path, parent);
+
+	long cut_bytes = cold->bytes, map_bytes = footprint__hashmap(parent->children);
+	int cut_weight = cold->thru_weight + cold->end_weight;
+
+	delete__hashmap(parent->children, cold->payload);
+	cut_bytes += map_bytes - footprint__hashmap(parent->children);
+
+	for (int path_node = 0; path_node < path.length; path_node++) {
+		path.node[path_node]->bytes -= cut_bytes;
+
+		if (path_node) // the root's weights are not used
+			path.node[path_node]->thru_weight -= cut_weight;
+	}
+
+	free(path.node);
+
+	return 0;
+}
+
+// evict until the trie fits in its budget again
+int trie_trim(trie_t *trie) {
+	if (!trie->budget)
+		return 0;
+
+	trie_unshare_root(trie);
+
+	while (trie->root_node->bytes > trie->budget && !trie_evict(trie));
+
+	return 0;
+}
+
+// rough number of bytes used by the trie (what '-m' is compared against)
+long trie_footprint(trie_t *trie) {
+	return trie->root_node ? trie->root_node->bytes : 0;
+}
+
+/*
+	PATTERN MATCHING
+
+	The glob is compiled into a list of tokens, where state i means "the
+	first i tokens have been matched". The walk carries the set of active
+	states down the trie and only goes into children that leave at least
+	one state active. When every active token accepts only a handful of
+	characters (literals, small classes) those children are looked up
+	directly; '?', '*' and big classes have to look at every child
+*/
+#define PATTERN_LOOKUPS 8 // most characters a token can look up directly
+
+typedef struct PatternToken {
+	int star; // '*': matches any run of characters (including none)
+
+	char accept[256]; // characters matched by a one character token
+	char lookup[PATTERN_LOOKUPS];
+	int lookup_length; // -1 if there are too many to look up
+} pattern_token;
+
+typedef struct PatternMatch {
+	trie_t *trie;
+
+	pattern_token *token;
+	int token_length;
+
+	int (*callback)(char *, int, void *);
+	void *arg; // handed to every callback
+	int limit, found;
+
+	char *key; // the key leading to the current node
+	int key_max;
+
+	// active states for every depth of the walk, one row of
+	// token_length + 1 per depth (key_max rows, grown with key)
+	char *state;
+} pattern_match_t;
+
+// the iterate__hashmap argument when going through every child
+typedef struct PatternStep {
+	pattern_match_t *match;
+	int depth;
+} pattern_step_t;
+
+// returns the number of tokens, or -1 for a malformed pattern
+int pattern_compile(char *pattern, pattern_token **token_out) {
+	pattern_token *token = malloc(sizeof(pattern_token) * (strlen(pattern) + 1));
+	int token_length = 0;
+
+	for (int pattern_pos = 0; pattern[pattern_pos]; pattern_pos++) {
+		pattern_token *curr_token = token + token_length;
+		unsigned char pattern_char = pattern[pattern_pos];
+
+		if (pattern_char == '*') {
+			if (!token_length || !token[token_length - 1].star) { // '**' is the same as '*'
+				curr_token->star = 1;
+				token_length++;
+			}
+
+			continue;
+		}
+
+		curr_token->star = 0;
+		memset(curr_token->accept, 0, sizeof(curr_token->accept));
+
+		if (pattern_char == '?')
+			memset(curr_token->accept + 1, 1, sizeof(curr_token->accept) - 1);
+		else if (pattern_char == '[') {
+			int class_start = ++pattern_pos;
+			int negate = pattern[pattern_pos] == '!' || pattern[pattern_pos] == '^';
+
+			if (negate)
+				class_start = ++pattern_pos;
+
+			// a ']' right after the '[' is part of the class
+			for (; pattern[pattern_pos] && (pattern_pos == class_start || pattern[pattern_pos] != ']'); pattern_pos++) {
+				unsigned char range_start = pattern[pattern_pos], range_end = range_start;
+
+				if (pattern[pattern_pos + 1] == '-' && pattern[pattern_pos + 2] && pattern[pattern_pos + 2] != ']') {
+					range_end = pattern[pattern_pos + 2];
+					pattern_pos += 2;
+				}
+
+				for (int class_char = range_start; class_char <= range_end; class_char++)
+					curr_token->accept[class_char] = 1;
+			}
+
+			if (!pattern[pattern_pos]) { // no closing ']'
+				free(token);
+				return -1;
+			}
+
+			if (negate)
+				for (int class_char = 1; class_char < 256; class_char++)
+					curr_token->accept[class_char] = !curr_token->accept[class_char];
+		} else {
+			if (pattern_char == '\\' && pattern[pattern_pos + 1])
+				pattern_char = pattern[++pattern_pos];
+
+			curr_token->accept[pattern_char] = 1;
+		}
+
+		curr_token->lookup_length = 0;
+		for (int class_char = 1; class_char < 256 && curr_token->lookup_length >= 0; class_char++) {
+			if (!curr_token->accept[class_char])
+				continue;
+
+			if (curr_token->lookup_length == PATTERN_LOOKUPS)
+				curr_token->lookup_length = -1;
+			else
+				curr_token->lookup[curr_token->lookup_length++] = class_char;
+		}
+
+		token_length++;
+	}
+
+	*token_out = token;
+	return token_length;
+}
+
+// a '*' can also match nothing, so the state after it is active too
+int pattern_closure(pattern_match_t *match, char *state) {
+	for (int token = 0; token < match->token_length; token++)
+		if (state[token] && match->token[token].star)
+			state[token + 1] = 1;
+
+	return 0;
+}
+
+int pattern_walk(pattern_match_t *match, node_t *node, int depth);
+
+// moves the active states over child_char and keeps walking from child
+int pattern_descend(pattern_match_t *match, node_t *child, char child_char, int depth) {
+	int state_width = match->token_length + 1;
+
+	if (depth + 2 > match->key_max) {
+		match->key_max *= 2;
+		match->key = realloc(match->key, sizeof(char) * match->key_max);
+		match->state = realloc(match->state, sizeof(char) * match->key_max * state_width);
+	}
+
+	char *state = match->state + depth * state_width;
+	char *next_state = state + state_width;
+	int any_state = 0;
+
+	memset(next_state, 0, sizeof(char) * state_width);
+
+	for (int token = 0; token < match->token_length; token++) {
+		if (!state[token])
+			continue;
+
+		if (match->token[token].star)
+			any_state = next_state[token] = 1;
+		else if (match->token[token].accept[(unsigned char) child_char])
+			any_state = next_state[token + 1] = 1;
+	}
+
+	if (!any_state) // nothing below child can match
+		return 0;
+
+	match->key[depth] = child_char;
+
+	pattern_closure(match, next_state);
+	return pattern_walk(match, child, depth + 1);
+}
+
+// iterate__hashmap visitor
+int pattern_descend_child(void *key, void *child, void *void_step) {
+	pattern_step_t *step = (pattern_step_t *) void_step;
+
+	return pattern_descend(step->match, (node_t *) child, ((char *) key)[0], step->depth);
+}
+
+// returns 1 once the walk should stop
+int pattern_walk(pattern_match_t *match, node_t *node, int depth) {
+	char *state = match->state + depth * (match->token_length + 1);
+
+	if (depth && state[match->token_length] && node->end_weight) {
+		match->key[depth] = '\0';
+		match->found++;
+
+		int weight = match->trie->graph_mode ? graph_search(match->trie, match->key) : node->end_weight;
+
+		if (match->callback(match->key, weight, match->arg) || match->found == match->limit)
+			return 1;
+	}
+
+	// gather the characters worth looking up, unless some token takes too many
+	char lookup[256];
+	int lookup_length = 0, lookup_all = 0;
+
+	for (int token = 0; token < match->token_length && !lookup_all; token++) {
+		if (!state[token])
+			continue;
+
+		if (match->token[token].star || match->token[token].lookup_length < 0) {
+			lookup_all = 1;
+			continue;
+		}
+
+		for (int token_char = 0; token_char < match->token[token].lookup_length; token_char++) {
+			char new_char = match->token[token].lookup[token_char];
+
+			int seen = 0;
+			while (seen < lookup_length && lookup[seen] != new_char)
+				seen++;
+
+			if (seen == lookup_length)
+				lookup[lookup_length++] = new_char;
+		}
+	}
+
+	if (lookup_all) {
+		pattern_step_t step = { .match = match, .depth = depth };
+
+		return iterate__hashmap(node->children, pattern_descend_child, &step);
+	}
+
+	for (int lookup_pos = 0; lookup_pos < lookup_length; lookup_pos++) {
+		char label[2] = { lookup[lookup_pos], '\0' };
+		node_t *child = get__hashmap(node->children, label);
+
+		if (child && pattern_descend(match, child, lookup[lookup_pos], depth))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+	trie_match_pattern calls callback(key, weight, arg) for every key in the
+	trie matching the glob pattern:
+		'?' matches any one character
+		'*' matches any run of characters (including none)
+		'[abc]', '[a-z]' match one character from the class, and
+		'[!abc]' (or '[^abc]') one character not in it
+		'\' makes the next character match itself
+	The key passed to callback is only good during the call. Returning
+	anything other than 0 from callback stops the search, as does reaching
+	limit matches (a limit of 0 means no limit). Keys come in no particular
+	order.
+	Returns the number of matches, or -1 if the pattern is malformed or
+	the trie is not a '-pc' trie
+*/
+int trie_match_pattern(trie_t *trie, char *pattern, int (*callback)(char *, int, void *), int limit, void *arg) {
+	if (!trie->root_node || !trie->payload_type)
+		return -1;
+
+	pattern_match_t match = {
+		.trie = trie,
+		.callback = callback,
+		.arg = arg,
+		.limit = limit,
+		.found = 0,
+		.key_max = 16
+	};
+
+	match.token_length = pattern_compile(pattern, &match.token);
+	if (match.token_length < 0)
+		return -1;
+
+	match.key = malloc(sizeof(char) * match.key_max);
+	match.state = calloc(match.key_max * (match.token_length + 1), sizeof(char));
+
+	match.state[0] = 1;
+	pattern_closure(&match, match.state);
+
+	pattern_walk(&match, trie->root_node, 0);
+
+	free(match.state);
+	free(match.key);
+	free(match.token);
+
+	return match.found;
+}
+
+/*
+	trie_destroy_step frees the trie a little at a time: each call lets go
+	of at most budget nodes (a negative budget frees everything). For a
+	graph that was never sealed, the register is freed first, budget
+	buckets at a time. This returns 1 while there is still more to free
+	and 0 once the trie itself has been freed.
+	After the first call the trie is detached -- searches return 0 and
+	inserts return 1 -- so a new trie can take its place right away and
+	the old one can be stepped down whenever there is time
+*/
+int trie_destroy_step(trie_t *trie, int budget) {
+	if (!trie->reclaim) {
+		trie->reclaim = malloc(sizeof(node_stack));
+
+		trie->reclaim->node = NULL;
+		trie->reclaim->length = 0;
+		trie->reclaim->max = 0;
+
+		if (trie->graph_last)
+			free(trie->graph_last);
+		trie->graph_last = NULL;
+
+		if (trie->graph_weight)
+			free(trie->graph_weight);
+		trie->graph_weight = NULL;
+
+		node_stack_push(trie->reclaim, trie->root_node);
+		trie->root_node = NULL;
+	}
+
+	// an unsealed graph still has its register: it only holds extra
+	// references, so it is dropped (in steps) before the nodes go
+	if (trie->graph_register) {
+		if (stepdestroy__hashmap(trie->graph_register, budget))
+			return 1;
+
+		trie->graph_register = NULL;
+	}
+
+	if (node_stack_reclaim(trie->reclaim, budget))
+		return 1;
+
+	free(trie->reclaim->node);
+	free(trie->reclaim);
 
 	free(trie);
 
+	return 0;
+}
+
+int trie_destroy(trie_t *trie) {
+	trie_destroy_step(trie, -1);
+
+	return 0;
+}
+
+/*
+	GRAPH MODE
+
+	Sorted keys are added with the incremental algorithm from Daciuk et al.
+	("Incremental Construction of Minimal Acyclic Finite-State Automata"):
+	only the path of the most recent key can still change, so once a new
+	key leaves that path everything below the split point is final and can
+	be swapped for an equivalent state from the register.
+
+	Each state keeps the number of keys that run through it in thru_weight
+	(itself included when end_weight is set). Adding up thru_weight over the
+	edges that sort before the one taken gives the rank of a key, which
+	indexes into graph_weight
+*/
+
+// build a string that is equal for two states only when they are
+// equivalent: same end flag and the same labels leading to the same states
+char *graph_signature(node_t *state) {
+	char *signature = malloc(sizeof(char) * (2 + state->order_length * (2 + sizeof(unsigned long) * 2)));
+	int sig_length = sprintf(signature, "%c", state->end_weight ? 'E' : 'N');
+
+	for (int edge = 0; edge < state->order_length; edge++) {
+		node_t *target = get__hashmap(state->children, state->order[edge]);
+
+		sig_length += sprintf(signature + sig_length, "%c%0*lx", state->order[edge][0],
+			(int) sizeof(unsigned long) * 2, (unsigned long) target);
+	}
+
+	return signature;
+}
+
+// Daciuk's replace_or_register: walk down the most recently added edges and
+// swap each state for an equivalent one that is already registered
+int graph_register(trie_t *trie, node_t *state) {
+	char *label = state->order[state->order_length - 1];
+	node_t *child = get__hashmap(state->children, label);
+
+	if (child->order_length)
+		graph_register(trie, child);
+
+	char *signature = graph_signature(child);
+	node_t *twin = get__hashmap(trie->graph_register, signature);
+
+	if (twin) {
+		free(signature);
+
+		// replacing the edge drops its reference to child, which frees it
+		twin->refs++;
+		insert__hashmap(state->children, label, twin, "", trie->comparer, NULL);
+	} else {
+		child->refs++;
+		insert__hashmap(trie->graph_register, signature, child, "", compareCharKey, destroyCharKey);
+	}
+
+	return 0;
+}
+
+int graph_insert(trie_t *trie, char *key) {
+	if (trie->graph_sealed || !key[0])
+		return 1;
+
+	if (trie->graph_last) {
+		int key_order = strcmp(key, trie->graph_last);
+
+		if (key_order < 0) // keys must come in sorted
+			return 1;
+
+		if (key_order == 0) {
+			trie->graph_weight[trie->graph_keys - 1]++;
+			return 0;
+		}
+	}
+
+	// follow the previous key for as long as it shares a prefix with this one
+	node_t *state = trie->root_node;
+	int depth = 0;
+
+	while (key[depth] && state->order_length && state->order[state->order_length - 1][0] == key[depth]) {
+		state->thru_weight++;
+
+		state = get__hashmap(state->children, state->order[state->order_length - 1]);
+		depth++;
+	}
+
+	// nothing below the split point can change anymore
+	if (state->order_length)
+		graph_register(trie, state);
+
+	for (; key[depth]; depth++) {
+		if (state->order_length == state->order_max) {
+			state->order_max = state->order_max ? state->order_max * 2 : 2;
+			state->order = realloc(state->order, sizeof(char *) * state->order_max);
+		}
+
+		char *label = singleton_maker(key + depth);
+		node_t *sub_node = node_construct(NULL, NULL);
+
+		state->order[state->order_length++] = label;
+		insert__hashmap(state->children, label, sub_node, "", trie->comparer, NULL);
+
+		state->thru_weight++;
+		state = sub_node;
+	}
+
+	state->thru_weight++;
+	state->end_weight = 1;
+
+	if (trie->graph_keys == trie->graph_max) {
+		trie->graph_max = trie->graph_max ? trie->graph_max * 2 : 8;
+		trie->graph_weight = realloc(trie->graph_weight, sizeof(int) * trie->graph_max);
+	}
+
+	trie->graph_weight[trie->graph_keys++] = 1;
+
+	if (trie->graph_last)
+		free(trie->graph_last);
+
+	trie->graph_last = malloc(sizeof(char) * (strlen(key) + 1));
+	strcpy(trie->graph_last, key);
+
+	return 0;
+}
+
+int graph_search(trie_t *trie, char *key) {
+	node_t *state = trie->root_node;
+	int rank = 0;
+
+	for (int depth = 0; key[depth]; depth++) {
+		node_t *sub_node = NULL;
+
+		// keys ending here and keys leaving through an earlier edge sort first
+		if (state->end_weight)
+			rank++;
+
+		for (int edge = 0; edge < state->order_length; edge++) {
+			node_t *target = get__hashmap(state->children, state->order[edge]);
+
+			if (state->order[edge][0] == key[depth]) {
+				sub_node = target;
+				break;
+			}
+
+			rank += target->thru_weight;
+		}
+
+		if (!sub_node)
+			return 0;
+
+		state = sub_node;
+	}
+
+	return state->end_weight ? trie->graph_weight[rank] : 0;
+}
+
+/*
+	trie_seal finishes a graph mode trie: the path of the last key is
+	merged like the rest and the register is dropped. After sealing the
+	graph is read only, trie_insert() will return 1
+*/
+int trie_seal(trie_t *trie) {
+	if (!trie->graph_mode || trie->graph_sealed || !trie->root_node)
+		return 1;
+
+	if (trie->root_node->order_length)
+		graph_register(trie, trie->root_node);
+
+	deepdestroy__hashmap(trie->graph_register);
+	trie->graph_register = NULL;
+
+	free(trie->graph_last);
+	trie->graph_last = NULL;
+
+	trie->graph_sealed = 1;
+
 	return 0;
 }
\ No newline at end of file
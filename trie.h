@@ -8,6 +8,18 @@ trie_t *trie_create(char *param, ...);
 int trie_insert(trie_t *trie, void *p_value);
 int trie_search(trie_t *trie, void *p_value);
 
+long trie_footprint(trie_t *trie);
+
+int trie_match_pattern(trie_t *trie, char *pattern, int (*callback)(char *, int, void *), int limit, void *arg);
+
+int trie_seal(trie_t *trie);
+
+trie_t *trie_snapshot(trie_t *trie);
+
+int trie_merge(trie_t *dst, trie_t *src);
+trie_t *trie_union(trie_t *trie_a, trie_t *trie_b);
+
+int trie_destroy_step(trie_t *trie, int budget);
 int trie_destroy(trie_t *trie);
 
 #endif
\ No newline at end of file